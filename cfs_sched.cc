@@ -1,137 +1,1134 @@
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
-#include <set>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 #include <string>
 
-// Structure representing a task with its attributes.
-struct Task {
+#include "multimap.h"
+
+// Default EEVDF request size (in ticks) when --slice is not given.
+const unsigned kDefaultSlice = 3;
+
+// Tasks are addressed by 32-bit handles into a TaskPool. Runqueues hold
+// EntityRefs: a task handle, or a group index with kGroupRef set.
+typedef uint32_t TaskHandle;
+typedef uint32_t EntityRef;
+const EntityRef kGroupRef = 0x80000000;
+const EntityRef kNoEntity = 0xffffffff;
+
+// The scheduling state shared by tasks and groups. A group entity
+// accumulates the vruntime of everything it runs.
+struct Entity {
+  char id;
+  unsigned vruntime;
+  unsigned last_run;  // Tick when the entity last ran.
+  explicit Entity(char i) : id(i), vruntime(0), last_run(0) {}
+};
+
+// A task as read from the task file. Fields that are only read on arrival,
+// first run and completion stay here instead of in the live Task.
+struct TaskSpec {
   char id;
   unsigned start_time;
   unsigned duration;
+  uint32_t group;  // GroupTree index of the task's group.
+};
+
+// A live task: only the state read on every tick, so a slot is no larger
+// than the original Task. Policy-specific state is kept by the policy,
+// indexed by task handle.
+struct Task : Entity {
+  uint32_t group;  // GroupTree index of the group whose runqueue holds it.
+  uint32_t spec;   // Index of the task's TaskSpec in Workload::arrivals.
   unsigned executed;
-  unsigned vruntime;
-  unsigned last_run;  // Tick when the task last ran.
-  Task(char i, unsigned st, unsigned d)
-      : id(i),
-        start_time(st),
-        duration(d),
-        executed(0),
-        vruntime(0),
-        last_run(0) {}
-  bool finished() const { return executed >= duration; }
-};
-
-// Custom comparator that orders tasks as follows:
+  Task(const TaskSpec &s, uint32_t index)
+      : Entity(s.id), group(s.group), spec(index), executed(0) {}
+};
+
+// Contiguous storage for live tasks. A task takes a slot when it arrives and
+// puts it on a free list when it finishes; later arrivals reuse free slots,
+// so the pool only grows to the peak number of live tasks. Runqueues refer
+// to tasks by 32-bit handle instead of by pointer.
+class TaskPool {
+ public:
+  TaskHandle Allocate(const TaskSpec &spec, uint32_t index);
+  void Free(TaskHandle h) { free_list.push_back(h); }
+  size_t Capacity() const { return slots.size(); }
+  const std::vector<TaskHandle> &FreeList() const { return free_list; }
+  void Restore(std::vector<Task> s, std::vector<TaskHandle> f) {
+    slots = std::move(s);
+    free_list = std::move(f);
+  }
+  Task &operator[](TaskHandle h) { return slots[h]; }
+  const Task &operator[](TaskHandle h) const { return slots[h]; }
+
+ private:
+  std::vector<Task> slots;
+  std::vector<TaskHandle> free_list;
+};
+
+// Returns the handle of a new task for the arrival at index, reusing a free
+// slot when there is one.
+TaskHandle TaskPool::Allocate(const TaskSpec &spec, uint32_t index) {
+  if (!free_list.empty()) {
+    TaskHandle h = free_list.back();
+    free_list.pop_back();
+    slots[h] = Task(spec, index);
+    return h;
+  }
+  if (slots.size() >= kGroupRef) {
+    throw std::runtime_error("Error: too many tasks");
+  }
+  slots.emplace_back(spec, index);
+  return slots.size() - 1;
+}
+
+// Key of a CFS runqueue. Entities are ordered as follows:
 // 1. By virtual runtime (lower comes first)
 // 2. If equal, by last_run (the one that ran earlier gets priority)
-// 3. Finally, by task identifier (lexicographical order)
-struct TaskComparator {
-  bool operator()(const Task *a, const Task *b) const {
-    if (a->vruntime != b->vruntime) return a->vruntime < b->vruntime;
-    if (a->last_run != b->last_run) return a->last_run < b->last_run;
-    return a->id < b->id;
+// 3. Then by identifier (lexicographical order; groups use 0)
+// 4. Finally, by entity reference
+struct RunKey {
+  unsigned vruntime;
+  unsigned last_run;
+  char id;
+  EntityRef ref;
+  static RunKey Of(const Entity &e, EntityRef ref) {
+    return RunKey{e.vruntime, e.last_run, e.id, ref};
+  }
+  bool operator<(const RunKey &o) const {
+    if (vruntime != o.vruntime) return vruntime < o.vruntime;
+    if (last_run != o.last_run) return last_run < o.last_run;
+    if (id != o.id) return id < o.id;
+    return ref < o.ref;
   }
+  bool operator>(const RunKey &o) const { return o < *this; }
+  bool operator==(const RunKey &o) const { return !(*this < o || o < *this); }
 };
 
-int main(int argc, char *argv[]) {
-  // Check for correct command-line usage.
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " <task_file.dat>" << std::endl;
-    return 1;
+// A task group with its own runqueue, scheduled as a single entity in the
+// runqueue of its parent. The root group has no parent.
+struct Group : Entity {
+  std::string name;
+  uint32_t index;  // Position in the GroupTree.
+  Group *parent;
+  Multimap<RunKey, EntityRef> queue;
+  EntityRef curr;          // Child picked to run; not held in queue.
+  unsigned min_vruntime;   // Virtual runtime of the last picked child.
+  size_t nr_tasks;         // Runnable tasks in this subtree.
+  unsigned tasks;          // Tasks assigned directly to this group.
+  unsigned long long cpu;  // Ticks consumed by this subtree.
+  // Fairness accounting. At every tick this group's k > 1 runnable children
+  // compete for, fair_clock advances by 1/k: the entitlement of each of
+  // them. A child accrues the advance of its parent's fair_clock while it is
+  // runnable (from fair_mark on) and counts the contended ticks it ran.
+  double fair_clock;
+  double fair_mark;
+  double entitled;
+  unsigned long long contended_cpu;
+  Group(const std::string &n, uint32_t i)
+      : Entity(0),
+        name(n),
+        index(i),
+        parent(nullptr),
+        curr(kNoEntity),
+        min_vruntime(0),
+        nr_tasks(0),
+        tasks(0),
+        cpu(0),
+        fair_clock(0),
+        fair_mark(0),
+        entitled(0),
+        contended_cpu(0) {}
+  EntityRef Ref() const { return kGroupRef | index; }
+};
+
+// Owns the group hierarchy. Groups are named by slash-separated paths such as
+// "web/api"; intermediate groups are created on demand.
+class GroupTree {
+ public:
+  GroupTree() { groups.emplace_back(new Group("/", 0)); }
+  Group *Root() const { return groups[0].get(); }
+  Group *Find(const std::string &path);
+  size_t Size() const { return groups.size(); }
+  Group *At(size_t i) const { return groups[i].get(); }
+  const std::map<std::string, Group *> &ByName() const { return by_name; }
+
+ private:
+  std::vector<std::unique_ptr<Group>> groups;
+  std::map<std::string, Group *> by_name;
+};
+
+// Returns the group for a path, creating it and its ancestors as needed.
+Group *GroupTree::Find(const std::string &path) {
+  Group *g = Root();
+  size_t begin = 0;
+  while (begin < path.size()) {
+    size_t end = path.find('/', begin);
+    if (end == std::string::npos) end = path.size();
+    if (end > begin) {
+      std::string name = path.substr(0, end);
+      auto it = by_name.find(name);
+      if (it == by_name.end()) {
+        Group *child = new Group(name, groups.size());
+        child->parent = g;
+        groups.emplace_back(child);
+        it = by_name.emplace(name, child).first;
+      }
+      g = it->second;
+    }
+    begin = end + 1;
   }
+  return g;
+}
 
-  std::ifstream infile(argv[1]);
-  if (!infile) {
-    std::cerr << "Error: cannot open file " << argv[1] << std::endl;
-    return 1;
+// Everything one simulation owns: its tasks, its groups and the order in
+// which tasks arrive.
+struct Workload {
+  TaskPool tasks;
+  GroupTree groups;
+  std::vector<TaskSpec> arrivals;  // Sorted by start time.
+  Entity *Get(EntityRef ref) {
+    if (ref & kGroupRef) return groups.At(ref & ~kGroupRef);
+    return &tasks[ref];
   }
+};
 
-  // Read tasks from the input file.
-  std::vector<Task *> tasks;
-  std::string line;
-  while (std::getline(infile, line)) {
-    if (line.empty()) continue;
-    std::istringstream iss(line);
-    char id;
-    unsigned st, dur;
-    if (!(iss >> id >> st >> dur)) continue;
-    tasks.push_back(new Task(id, st, dur));
+// Key of the EEVDF runqueue: tasks are ordered by the virtual time at which
+// they become eligible, with the task identifier breaking ties.
+struct EligibleKey {
+  unsigned eligible;
+  char id;
+  TaskHandle handle;
+  bool operator<(const EligibleKey &o) const {
+    if (eligible != o.eligible) return eligible < o.eligible;
+    if (id != o.id) return id < o.id;
+    return handle < o.handle;
+  }
+  bool operator>(const EligibleKey &o) const { return o < *this; }
+  bool operator==(const EligibleKey &o) const {
+    return eligible == o.eligible && id == o.id && handle == o.handle;
+  }
+};
+
+// EEVDF bookkeeping of a live task, indexed by task handle.
+struct EevdfTask {
+  unsigned eligible;  // Virtual time from which the task may be picked.
+  unsigned deadline;  // Virtual deadline of the current request.
+};
+
+// Orders EEVDF candidates by virtual deadline, then by virtual runtime and
+// task identifier so that picks are deterministic.
+struct DeadlineComparator {
+  const TaskPool *pool;
+  const std::vector<EevdfTask> *sched;
+  bool operator()(TaskHandle x, TaskHandle y) const {
+    const Task &a = (*pool)[x];
+    const Task &b = (*pool)[y];
+    unsigned da = (*sched)[x].deadline, db = (*sched)[y].deadline;
+    if (da != db) return da < db;
+    if (a.vruntime != b.vruntime) return a.vruntime < b.vruntime;
+    if (a.id != b.id) return a.id < b.id;
+    return x < y;
   }
+};
 
-  // Sort tasks by start time.
-  std::sort(tasks.begin(), tasks.end(), [](const Task *a, const Task *b) {
-    return a->start_time < b->start_time;
-  });
+// Per-run summary used to compare scheduling policies.
+struct Metrics {
+  unsigned ticks = 0;
+  unsigned completed = 0;
+  unsigned long long total_response = 0;    // Arrival to first run.
+  unsigned long long total_turnaround = 0;  // Arrival to completion.
+};
 
+// Progress of a run that is common to both policies.
+struct RunState {
   unsigned tick = 0;
-  unsigned global_min_vruntime =
-      0;  // Initialize global minimum virtual runtime.
-  std::set<Task *, TaskComparator> ready;
-  Task *current = nullptr;
-  size_t next_task_index = 0;
+  size_t next_task_index = 0;  // First task, in start order, yet to arrive.
+  Metrics metrics;
+};
+
+// Runqueue state of the EEVDF policy. The runqueue's comparator points into
+// tasks, so the state is never copied.
+struct EevdfState {
+  explicit EevdfState(const TaskPool *p)
+      : pool(p), ready(DeadlineComparator{p, &tasks}) {}
+  EevdfState(const EevdfState &) = delete;
+  EligibleKey KeyOf(TaskHandle h) const {
+    return EligibleKey{tasks[h].eligible, (*pool)[h].id, h};
+  }
+  const TaskPool *pool;
+  std::vector<EevdfTask> tasks;  // Grows with the pool.
+  Multimap<EligibleKey, TaskHandle, DeadlineComparator> ready;
+  TaskHandle current = kNoEntity;
+  unsigned long long sum_vruntime = 0;  // Over ready tasks and current.
+  unsigned avg_vruntime = 0;            // V, kept when the queue drains.
+};
+
+// Accounts for one tick of execution of t, read from spec, at the given
+// tick. Returns true if the task has finished.
+bool RunTick(Task *t, const TaskSpec &spec, unsigned tick, Metrics *metrics) {
+  if (t->executed == 0) metrics->total_response += tick - spec.start_time;
+  t->executed++;
+  t->vruntime++;
+  t->last_run = tick;  // Update the last run tick.
+  if (t->executed < spec.duration) return false;
+  metrics->completed++;
+  metrics->total_turnaround += tick + 1 - spec.start_time;
+  return true;
+}
+
+// Prints the scheduling status of a single tick.
+void PrintTick(unsigned tick, size_t total_tasks, const Task *current,
+               std::ostream &out) {
+  char print_id = current ? current->id : '_';
+  out << tick << " [" << total_tasks << "]: " << print_id;
+}
+
+// Queues a newly arrived task on its group, and every group that was idle so
+// far on the runqueue of its parent. New entities start at the minimum
+// virtual runtime of the runqueue they join.
+void EnqueueTask(Workload *w, TaskHandle h) {
+  Task &t = w->tasks[h];
+  Group *g = w->groups.At(t.group);
+  t.vruntime = g->min_vruntime;
+  g->queue.Insert(RunKey::Of(t, h), h);
+  for (; g; g = g->parent) {
+    if (g->nr_tasks++ == 0 && g->parent) {
+      g->vruntime = g->parent->min_vruntime;
+      g->fair_mark = g->parent->fair_clock;
+      g->parent->queue.Insert(RunKey::Of(*g, g->Ref()), g->Ref());
+    }
+  }
+}
+
+// Puts the running entity of g, and everything picked below it, back on
+// their runqueues.
+void PutPrev(Workload *w, Group *g) {
+  while (g->curr != kNoEntity) {
+    EntityRef c = g->curr;
+    g->queue.Insert(RunKey::Of(*w->Get(c), c), c);
+    g->curr = kNoEntity;
+    if (!(c & kGroupRef)) break;
+    g = w->groups.At(c & ~kGroupRef);
+  }
+}
+
+// Descends from the root picking the leftmost entity of each runqueue that
+// has no running entity yet, and returns the task to run, if any.
+TaskHandle PickNext(Workload *w) {
+  Group *g = w->groups.Root();
+  while (true) {
+    if (g->curr == kNoEntity) {
+      if (g->queue.Size() == 0) return kNoEntity;
+      RunKey top = g->queue.Min();
+      g->curr = top.ref;
+      g->queue.Remove(top);
+      // Update the runqueue minimum to the picked entity's virtual runtime.
+      g->min_vruntime = top.vruntime;
+    }
+    if (!(g->curr & kGroupRef)) return g->curr;
+    g = w->groups.At(g->curr & ~kGroupRef);
+  }
+}
+
+// Set from the SIGUSR1 handler to request a checkpoint at the next tick.
+volatile std::sig_atomic_t checkpoint_requested = 0;
+
+void RequestCheckpoint(int) { checkpoint_requested = 1; }
+
+// Where and how often checkpoints are written.
+struct CheckpointConfig {
+  std::string path;    // Empty disables checkpointing.
+  unsigned every = 0;  // Ticks between checkpoints; 0 means on SIGUSR1 only.
+  bool Due(unsigned tick) const {
+    if (path.empty()) return false;
+    if (checkpoint_requested) {
+      checkpoint_requested = 0;
+      return true;
+    }
+    return every > 0 && tick % every == 0;
+  }
+};
+
+// Checkpoint layout (native byte order):
+//   header:   magic, version, policy, task count, RunState
+//   pool:     every slot of the TaskPool, then its free list in order, so
+//             that later arrivals get the same handles after a restore
+//   policy:   CFS: per group, its entity fields, running child and runqueue
+//             EEVDF: per slot bookkeeping, vruntime sum and average, current
+//             task and runqueue
+// Entities are written as EntityRefs. Runqueues are written in key order so
+// that restoring them is a linear-time Multimap::LoadSorted() instead of one
+// insertion per entity.
+const uint32_t kCheckpointMagic = 0x4b435454;  // "TTCK"
+const uint32_t kCheckpointVersion = 6;
+
+template <typename T>
+void Put(std::ostream &out, T v) {
+  out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template <typename T>
+T Take(std::istream &in) {
+  T v;
+  if (!in.read(reinterpret_cast<char *>(&v), sizeof(v))) {
+    throw std::runtime_error("Error: truncated checkpoint");
+  }
+  return v;
+}
+
+// Reads an EntityRef, checking that it names a task or group of w.
+EntityRef TakeRef(std::istream &in, const Workload &w) {
+  EntityRef ref = Take<EntityRef>(in);
+  if (ref == kNoEntity) return ref;
+  if ((ref & kGroupRef) ? (ref & ~kGroupRef) < w.groups.Size()
+                        : ref < w.tasks.Capacity()) {
+    return ref;
+  }
+  throw std::runtime_error("Error: bad entity in checkpoint");
+}
+
+// Writes the header and the task pool of a checkpoint.
+void PutCommon(std::ostream &out, uint8_t policy, const Workload &w,
+               const RunState &state) {
+  Put<uint32_t>(out, kCheckpointMagic);
+  Put<uint32_t>(out, kCheckpointVersion);
+  Put<uint8_t>(out, policy);
+  Put<uint64_t>(out, w.arrivals.size());
+  Put<uint32_t>(out, state.tick);
+  Put<uint64_t>(out, state.next_task_index);
+  Put<uint32_t>(out, state.metrics.completed);
+  Put<uint64_t>(out, state.metrics.total_response);
+  Put<uint64_t>(out, state.metrics.total_turnaround);
+  Put<uint64_t>(out, w.tasks.Capacity());
+  for (size_t h = 0; h < w.tasks.Capacity(); h++) {
+    const Task &t = w.tasks[h];
+    Put<uint32_t>(out, t.spec);
+    Put<uint32_t>(out, t.executed);
+    Put<uint32_t>(out, t.vruntime);
+    Put<uint32_t>(out, t.last_run);
+  }
+  Put<uint64_t>(out, w.tasks.FreeList().size());
+  for (TaskHandle h : w.tasks.FreeList()) Put(out, h);
+}
+
+// Reads what PutCommon() wrote and restores the task pool.
+void TakeCommon(std::istream &in, uint8_t policy, Workload *w,
+                RunState *state) {
+  if (Take<uint32_t>(in) != kCheckpointMagic ||
+      Take<uint32_t>(in) != kCheckpointVersion) {
+    throw std::runtime_error("Error: not a checkpoint file");
+  }
+  if (Take<uint8_t>(in) != policy) {
+    throw std::runtime_error("Error: checkpoint is for another policy");
+  }
+  if (Take<uint64_t>(in) != w->arrivals.size()) {
+    throw std::runtime_error("Error: checkpoint is for another task file");
+  }
+  state->tick = Take<uint32_t>(in);
+  state->next_task_index = Take<uint64_t>(in);
+  state->metrics.completed = Take<uint32_t>(in);
+  state->metrics.total_response = Take<uint64_t>(in);
+  state->metrics.total_turnaround = Take<uint64_t>(in);
+  if (state->next_task_index > w->arrivals.size()) {
+    throw std::runtime_error("Error: bad arrival index in checkpoint");
+  }
+
+  // A slot is only ever taken by an arrival, so there are at most as many
+  // slots as tasks that have arrived.
+  uint64_t capacity = Take<uint64_t>(in);
+  if (capacity > state->next_task_index) {
+    throw std::runtime_error("Error: bad task pool in checkpoint");
+  }
+  std::vector<Task> slots;
+  for (uint64_t h = 0; h < capacity; h++) {
+    uint32_t index = Take<uint32_t>(in);
+    if (index >= state->next_task_index) {
+      throw std::runtime_error("Error: bad task in checkpoint");
+    }
+    Task t(w->arrivals[index], index);
+    t.executed = Take<uint32_t>(in);
+    t.vruntime = Take<uint32_t>(in);
+    t.last_run = Take<uint32_t>(in);
+    slots.push_back(t);
+  }
+  std::vector<TaskHandle> free_list(Take<uint64_t>(in));
+  if (free_list.size() > capacity) {
+    throw std::runtime_error("Error: bad task pool in checkpoint");
+  }
+  for (TaskHandle &h : free_list) {
+    h = Take<TaskHandle>(in);
+    if (h >= capacity) {
+      throw std::runtime_error("Error: bad task in checkpoint");
+    }
+  }
+  w->tasks.Restore(std::move(slots), std::move(free_list));
+}
+
+// Writes bytes to path through a temporary file so that a crash never leaves
+// a partial checkpoint behind.
+void WriteCheckpoint(const std::string &path, const std::string &bytes) {
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size());
+  out.close();
+  if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::cerr << "Error: cannot write checkpoint " << path << std::endl;
+  }
+}
+
+void SaveCfs(const std::string &path, const Workload &w,
+             const RunState &state) {
+  std::ostringstream out;
+  PutCommon(out, 0, w, state);
+  Put<uint32_t>(out, w.groups.Size());
+  for (size_t i = 0; i < w.groups.Size(); i++) {
+    const Group *g = w.groups.At(i);
+    Put<uint32_t>(out, g->vruntime);
+    Put<uint32_t>(out, g->last_run);
+    Put<uint32_t>(out, g->min_vruntime);
+    Put<uint64_t>(out, g->nr_tasks);
+    Put<uint64_t>(out, g->cpu);
+    Put<double>(out, g->fair_clock);
+    Put<double>(out, g->fair_mark);
+    Put<double>(out, g->entitled);
+    Put<uint64_t>(out, g->contended_cpu);
+    Put<EntityRef>(out, g->curr);
+    Put<uint32_t>(out, g->queue.Size());
+    g->queue.ForEach([&](const RunKey &, EntityRef ref) { Put(out, ref); });
+  }
+  WriteCheckpoint(path, out.str());
+}
+
+// Restores a CFS checkpoint taken on the same task file and group layout.
+void LoadCfs(const std::string &path, Workload *w, RunState *state) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Error: cannot open file " + path);
+  TakeCommon(in, 0, w, state);
+  if (Take<uint32_t>(in) != w->groups.Size()) {
+    throw std::runtime_error("Error: checkpoint has another group layout");
+  }
+  // Group entity fields are needed to key the parent runqueue, so every
+  // group is read before any runqueue is rebuilt.
+  std::vector<std::vector<EntityRef>> queues(w->groups.Size());
+  for (size_t i = 0; i < w->groups.Size(); i++) {
+    Group *g = w->groups.At(i);
+    g->vruntime = Take<uint32_t>(in);
+    g->last_run = Take<uint32_t>(in);
+    g->min_vruntime = Take<uint32_t>(in);
+    g->nr_tasks = Take<uint64_t>(in);
+    g->cpu = Take<uint64_t>(in);
+    g->fair_clock = Take<double>(in);
+    g->fair_mark = Take<double>(in);
+    g->entitled = Take<double>(in);
+    g->contended_cpu = Take<uint64_t>(in);
+    g->curr = TakeRef(in, *w);
+    uint32_t size = Take<uint32_t>(in);
+    for (uint32_t j = 0; j < size; j++) {
+      EntityRef ref = TakeRef(in, *w);
+      if (ref == kNoEntity) {
+        throw std::runtime_error("Error: bad entity in checkpoint");
+      }
+      queues[i].push_back(ref);
+    }
+  }
+  for (size_t i = 0; i < w->groups.Size(); i++) {
+    std::vector<RunKey> keys;
+    for (EntityRef ref : queues[i]) {
+      keys.push_back(RunKey::Of(*w->Get(ref), ref));
+    }
+    w->groups.At(i)->queue.LoadSorted(keys, queues[i]);
+  }
+}
+
+void SaveEevdf(const std::string &path, const Workload &w,
+               const RunState &state, const EevdfState &eevdf) {
+  std::ostringstream out;
+  PutCommon(out, 1, w, state);
+  for (const EevdfTask &t : eevdf.tasks) {
+    Put<uint32_t>(out, t.eligible);
+    Put<uint32_t>(out, t.deadline);
+  }
+  Put<uint64_t>(out, eevdf.sum_vruntime);
+  Put<uint32_t>(out, eevdf.avg_vruntime);
+  Put<EntityRef>(out, eevdf.current);
+  Put<uint32_t>(out, eevdf.ready.Size());
+  eevdf.ready.ForEach([&](const EligibleKey &, TaskHandle h) { Put(out, h); });
+  WriteCheckpoint(path, out.str());
+}
+
+// Restores an EEVDF checkpoint taken on the same task file.
+void LoadEevdf(const std::string &path, Workload *w, RunState *state,
+               EevdfState *eevdf) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Error: cannot open file " + path);
+  TakeCommon(in, 1, w, state);
+  eevdf->tasks.resize(w->tasks.Capacity());
+  for (EevdfTask &t : eevdf->tasks) {
+    t.eligible = Take<uint32_t>(in);
+    t.deadline = Take<uint32_t>(in);
+  }
+  eevdf->sum_vruntime = Take<uint64_t>(in);
+  eevdf->avg_vruntime = Take<uint32_t>(in);
+  // Only tasks are ever queued, so group references are rejected here.
+  auto take_task = [&]() {
+    EntityRef ref = TakeRef(in, *w);
+    if (ref != kNoEntity && (ref & kGroupRef)) {
+      throw std::runtime_error("Error: bad entity in checkpoint");
+    }
+    return ref;
+  };
+  eevdf->current = take_task();
+  uint32_t size = Take<uint32_t>(in);
+  std::vector<EligibleKey> keys;
+  std::vector<TaskHandle> values;
+  for (uint32_t i = 0; i < size; i++) {
+    TaskHandle h = take_task();
+    if (h == kNoEntity) {
+      throw std::runtime_error("Error: bad entity in checkpoint");
+    }
+    keys.push_back(eevdf->KeyOf(h));
+    values.push_back(h);
+  }
+  eevdf->ready.LoadSorted(keys, values);
+}
+
+// Reports root runqueue statistics from a background thread. The scheduler
+// posts Multimap snapshots, which cost O(1) and stay valid while it keeps
+// updating the queue, so sampling never stalls the simulation on output.
+// Only the newest unreported sample is kept: a post replaces it and counts a
+// drop, so a slow reporter holds on to at most one old version of the tree.
+class Monitor {
+ public:
+  typedef Multimap<RunKey, EntityRef>::View View;
+  Monitor(unsigned every, std::ostream &out)
+      : every(every),
+        out(out),
+        dropped(0),
+        done(false),
+        thread(&Monitor::Loop, this) {}
+  ~Monitor();
+  bool Due(unsigned tick) const { return every > 0 && tick % every == 0; }
+  void Post(unsigned tick, const View &view);
+
+ private:
+  void Loop();
+  unsigned every;
+  std::ostream &out;
+  std::mutex mu;
+  std::condition_variable ready;
+  struct Sample {
+    unsigned tick;
+    View view;
+  };
+  std::unique_ptr<Sample> latest;  // Newest unreported sample, if any.
+  unsigned long long dropped;      // Samples replaced since the last report.
+  bool done;
+  std::thread thread;  // Last, so it starts after the fields it reads.
+};
+
+// Reports the pending sample, if any, before returning.
+Monitor::~Monitor() {
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    done = true;
+  }
+  ready.notify_one();
+  thread.join();
+}
+
+// Replaces the unreported sample, if any. The replaced view is released
+// after the lock is dropped, so the reporter never waits on it.
+void Monitor::Post(unsigned tick, const View &view) {
+  std::unique_ptr<Sample> sample(new Sample{tick, view});
+  {
+    std::lock_guard<std::mutex> lock(mu);
+    if (latest) dropped++;
+    latest.swap(sample);
+  }
+  ready.notify_one();
+}
+
+// Prints, per sample, the queued entities, how many of them are groups, the
+// spread between the lowest and highest queued virtual runtime and how many
+// samples were replaced before they could be reported.
+void Monitor::Loop() {
+  std::unique_lock<std::mutex> lock(mu);
+  while (true) {
+    ready.wait(lock, [this] { return done || latest; });
+    if (!latest) return;
+    std::unique_ptr<Sample> sample = std::move(latest);
+    unsigned long long drops = dropped;
+    dropped = 0;
+    lock.unlock();
+    const View &view = sample->view;
+    unsigned groups = 0;
+    view.ForEach([&](const RunKey &, EntityRef ref) {
+      if (ref & kGroupRef) groups++;
+    });
+    unsigned spread =
+        view.Size() > 0 ? view.Max().vruntime - view.Min().vruntime : 0;
+    out << "monitor tick=" << sample->tick << " queued=" << view.Size()
+        << " groups=" << groups << " spread=" << spread
+        << " dropped=" << drops << std::endl;
+    sample.reset();
+    lock.lock();
+  }
+}
+
+// Runs the Completely Fair Scheduler over the workload. Each group has its
+// own runqueue, so a pick costs O(depth * log(width)); without groups every
+// task is queued on the root and scheduling is flat.
+void RunCfs(Workload *w, RunState *state, const CheckpointConfig &checkpoint,
+            Monitor *monitor, std::ostream &out) {
+  Group *root = w->groups.Root();
+  unsigned &tick = state->tick;
+  size_t &next_task_index = state->next_task_index;
 
   // Main scheduling loop: runs until all tasks have been processed.
-  while (next_task_index < tasks.size() || !ready.empty() ||
-         current != nullptr) {
+  while (next_task_index < w->arrivals.size() || root->nr_tasks > 0) {
+    if (checkpoint.Due(tick)) SaveCfs(checkpoint.path, *w, *state);
+
     // Add tasks that arrive at the current tick.
-    while (next_task_index < tasks.size() &&
-           tasks[next_task_index]->start_time == tick) {
-      Task *t = tasks[next_task_index];
-      // Initialize the new task's virtual runtime to the global minimum.
-      t->vruntime = global_min_vruntime;
-      ready.insert(t);
+    while (next_task_index < w->arrivals.size() &&
+           w->arrivals[next_task_index].start_time == tick) {
+      EnqueueTask(w, w->tasks.Allocate(w->arrivals[next_task_index],
+                                        next_task_index));
       next_task_index++;
     }
 
-    // If there is a running task and a ready task with a lower virtual runtime
-    // exists, preempt the current task.
-    if (current && !ready.empty()) {
-      Task *top = *ready.begin();
-      if (top->vruntime < current->vruntime) {
-        ready.insert(current);
-        current = nullptr;
+    // If a runqueue on the running path holds an entity with a lower virtual
+    // runtime than the one running there, preempt the current task.
+    for (Group *g = root; g->curr != kNoEntity;) {
+      Entity *c = w->Get(g->curr);
+      if (g->queue.Size() > 0 && g->queue.Min().vruntime < c->vruntime) {
+        PutPrev(w, g);
+        break;
       }
+      if (!(g->curr & kGroupRef)) break;
+      g = static_cast<Group *>(c);
     }
 
-    // If no task is currently running, select the next task.
-    if (!current) {
-      if (!ready.empty()) {
-        current = *ready.begin();
-        ready.erase(ready.begin());
-        // Update global minimum to the current task's virtual runtime.
-        global_min_vruntime = current->vruntime;
-      }
+    // Tasks do not move while one runs: slots are only taken on arrival.
+    TaskHandle handle = PickNext(w);
+    Task *current = handle != kNoEntity ? &w->tasks[handle] : nullptr;
+    if (monitor && monitor->Due(tick)) {
+      monitor->Post(tick, root->queue.Snapshot());
     }
 
-    // Total runnable tasks: ready tasks plus the current task if one is
+    // Total runnable tasks: queued tasks plus the current task if one is
     // running.
-    size_t total_tasks = ready.size() + (current ? 1 : 0);
-    char print_id = current ? current->id : '_';
-
-    // Print the scheduling status.
-    std::cout << tick << " [" << total_tasks << "]: " << print_id;
+    PrintTick(tick, root->nr_tasks, current, out);
 
-    bool finished = false;
+    // Run the current task for one tick, charging its groups as well. If it
+    // finishes during this tick, mark it, dequeue emptied groups and release
+    // its slot.
     if (current) {
-      // Run the current task for one tick.
-      current->executed++;
-      current->vruntime++;
-      current->last_run = tick;  // Update the last run tick.
-      if (current->finished()) finished = true;
+      Group *parent = w->groups.At(current->group);
+      // Every group on the running path has its running child in curr.
+      for (Group *g = parent; g; g = g->parent) {
+        size_t runnable = g->queue.Size() + 1;
+        if (runnable < 2) continue;
+        g->fair_clock += 1.0 / runnable;
+        if (g->curr & kGroupRef) {
+          w->groups.At(g->curr & ~kGroupRef)->contended_cpu++;
+        }
+      }
+      bool finished = RunTick(current, w->arrivals[current->spec], tick,
+                              &state->metrics);
+      for (Group *g = parent; g; g = g->parent) {
+        g->vruntime++;
+        g->last_run = tick;
+        g->cpu++;
+      }
+      if (finished) {
+        out << "*";
+        EntityRef done = handle;
+        for (Group *g = parent; g; g = g->parent) {
+          if (g->curr == done) g->curr = kNoEntity;
+          done = --g->nr_tasks == 0 ? g->Ref() : kNoEntity;
+          if (done != kNoEntity && g->parent) {
+            g->entitled += g->parent->fair_clock - g->fair_mark;
+          }
+        }
+        w->tasks.Free(handle);
+      }
+    }
+    out << std::endl;
+
+    tick++;  // Increment tick for the next iteration.
+  }
+
+  state->metrics.ticks = tick;
+}
+
+// Runs the Earliest Eligible Virtual Deadline First scheduler over the
+// workload. Every task issues requests of `slice` ticks; among the tasks
+// whose lag is non-negative (vruntime not ahead of the average vruntime V of
+// all runnable tasks) the one with the earliest virtual deadline runs. The
+// runqueue is keyed by eligible time and caches the minimum deadline of every
+// subtree, so a pick costs O(log n). Groups are not modeled: all tasks share
+// one runqueue.
+void RunEevdf(Workload *w, unsigned slice, RunState *state,
+              EevdfState *eevdf, const CheckpointConfig &checkpoint,
+              std::ostream &out) {
+  TaskPool &pool = w->tasks;
+  unsigned &tick = state->tick;
+  size_t &next_task_index = state->next_task_index;
+  Multimap<EligibleKey, TaskHandle, DeadlineComparator> &ready = eevdf->ready;
+  TaskHandle &current = eevdf->current;
+  std::vector<EevdfTask> &sched = eevdf->tasks;
+
+  // Recomputes V and returns the largest key that is still eligible.
+  auto eligible_bound = [&]() {
+    size_t runnable = ready.Size() + (current != kNoEntity ? 1 : 0);
+    if (runnable > 0) eevdf->avg_vruntime = eevdf->sum_vruntime / runnable;
+    return EligibleKey{eevdf->avg_vruntime, CHAR_MAX, UINT_MAX};
+  };
+  // Queues a task, recording the point from which it is eligible. A task's
+  // lag is V minus its vruntime, so it is eligible once V reaches its
+  // vruntime; tasks never leave and rejoin, so lag needs no storing.
+  auto enqueue = [&](TaskHandle h) {
+    sched[h].eligible = pool[h].vruntime;
+    ready.Insert(eevdf->KeyOf(h), h);
+  };
+
+  while (next_task_index < w->arrivals.size() || ready.Size() > 0 ||
+         current != kNoEntity) {
+    if (checkpoint.Due(tick)) SaveEevdf(checkpoint.path, *w, *state, *eevdf);
+
+    // New tasks join with zero lag: their vruntime is placed at V.
+    while (next_task_index < w->arrivals.size() &&
+           w->arrivals[next_task_index].start_time == tick) {
+      TaskHandle h =
+          pool.Allocate(w->arrivals[next_task_index], next_task_index);
+      if (sched.size() < pool.Capacity()) sched.resize(pool.Capacity());
+      Task &t = pool[h];
+      eligible_bound();
+      t.vruntime = eevdf->avg_vruntime;
+      sched[h].deadline = t.vruntime + slice;
+      eevdf->sum_vruntime += t.vruntime;
+      enqueue(h);
+      next_task_index++;
     }
 
-    // If the task finishes during this tick, mark it and deallocate.
-    if (finished) {
-      std::cout << "*";
-      delete current;
-      current = nullptr;
+    // Preempt the current task only if an eligible task has a strictly
+    // earlier deadline. The pick order's tie-breaks must not apply here, or
+    // an equal deadline would preempt every tick and cut the request short.
+    if (current != kNoEntity && ready.Size() > 0) {
+      const TaskHandle *top = ready.MinValueAtMost(eligible_bound());
+      if (top && sched[*top].deadline < sched[current].deadline) {
+        enqueue(current);
+        current = kNoEntity;
+      }
     }
-    std::cout << std::endl;
 
-    tick++;  // Increment tick for the next iteration.
+    // If no task is currently running, pick the earliest eligible deadline.
+    if (current == kNoEntity && ready.Size() > 0) {
+      const TaskHandle *top = ready.MinValueAtMost(eligible_bound());
+      if (top) {
+        current = *top;
+        ready.Remove(eevdf->KeyOf(current));
+      }
+    }
+
+    Task *running = current != kNoEntity ? &pool[current] : nullptr;
+    size_t total_tasks = ready.Size() + (running ? 1 : 0);
+    PrintTick(tick, total_tasks, running, out);
+
+    if (running) {
+      bool finished = RunTick(running, w->arrivals[running->spec], tick,
+                              &state->metrics);
+      eevdf->sum_vruntime++;
+      if (finished) {
+        out << "*";
+        eevdf->sum_vruntime -= running->vruntime;
+        pool.Free(current);
+        current = kNoEntity;
+      } else if (running->vruntime >= sched[current].deadline) {
+        // The request is complete: issue the next one and requeue.
+        sched[current].deadline = running->vruntime + slice;
+        eligible_bound();
+        enqueue(current);
+        current = kNoEntity;
+      }
+    }
+    out << std::endl;
+
+    tick++;
+  }
+
+  state->metrics.ticks = tick;
+}
+
+// Prints a one-line summary of a run.
+void PrintMetrics(const std::string &policy, const Metrics &m,
+                  std::ostream &out) {
+  double done = m.completed ? m.completed : 1;
+  out << std::fixed << std::setprecision(2) << "policy=" << policy
+      << " completed=" << m.completed << " ticks=" << m.ticks
+      << " avg_response=" << m.total_response / done
+      << " avg_turnaround=" << m.total_turnaround / done
+      << " throughput=" << std::setprecision(4)
+      << (m.ticks ? static_cast<double>(m.completed) / m.ticks : 0.0)
+      << std::endl;
+}
+
+// Prints, for every group, the CPU time its subtree received and, over the
+// ticks it competed with runnable siblings, the CPU it got against its fair
+// entitlement. fairness=1 means an equal share of the parent while
+// contended; '-' means the group never competed.
+void PrintGroupMetrics(const GroupTree &tree, std::ostream &out) {
+  for (const auto &entry : tree.ByName()) {
+    const Group *g = entry.second;
+    out << std::fixed << std::setprecision(2) << "group=" << g->name
+        << " tasks=" << g->tasks << " cpu=" << g->cpu
+        << " contended_cpu=" << g->contended_cpu
+        << " entitled=" << g->entitled << " fairness=";
+    if (g->entitled > 0) {
+      out << std::setprecision(4) << g->contended_cpu / g->entitled;
+    } else {
+      out << "-";
+    }
+    out << std::endl;
+  }
+}
+
+// Reads tasks from a task file and sorts their arrivals by start time. An
+// optional fourth column names the group of the task; tasks without one
+// belong to the root group. Returns false if the file cannot be opened.
+bool LoadTasks(const std::string &path, Workload *w) {
+  std::ifstream infile(path);
+  if (!infile) return false;
+
+  std::string line;
+  while (std::getline(infile, line)) {
+    if (line.empty()) continue;
+    std::istringstream iss(line);
+    char id;
+    unsigned st, dur;
+    std::string group;
+    if (!(iss >> id >> st >> dur)) continue;
+    // A token starting with '#' begins a trailing comment, not a group.
+    bool grouped = (iss >> group) && group[0] != '#';
+    Group *g = grouped ? w->groups.Find(group) : w->groups.Root();
+    g->tasks++;
+    w->arrivals.push_back(TaskSpec{id, st, dur, g->index});
+  }
+
+  // Sort arrivals by start time; equal start times keep their input order so
+  // that a resumed run sees the same arrival sequence.
+  std::stable_sort(w->arrivals.begin(), w->arrivals.end(),
+                   [](const TaskSpec &a, const TaskSpec &b) {
+                     return a.start_time < b.start_time;
+                   });
+  return true;
+}
+
+// One simulation of a batch: a task file and the parameters to run it with.
+struct BatchJob {
+  std::string path;
+  std::string policy;
+  unsigned slice;
+};
+
+// Reads a batch file with one job per line, "<task_file> [policy] [slice]".
+// Missing fields take the values given on the command line; blank lines and
+// lines starting with '#' are skipped.
+bool ReadBatch(const std::string &path, const std::string &policy,
+               unsigned slice, std::vector<BatchJob> *jobs) {
+  std::ifstream infile(path);
+  if (!infile) {
+    std::cerr << "Error: cannot open file " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  for (unsigned lineno = 1; std::getline(infile, line); lineno++) {
+    std::istringstream iss(line);
+    BatchJob job{"", policy, slice};
+    if (!(iss >> job.path) || job.path[0] == '#') continue;
+    iss >> job.policy >> job.slice;
+    if ((job.policy != "cfs" && job.policy != "eevdf") || job.slice == 0) {
+      std::cerr << "Error: bad job on line " << lineno << " of " << path
+                << std::endl;
+      return false;
+    }
+    jobs->push_back(job);
+  }
+  return true;
+}
+
+// Runs one job to completion with the trace discarded and returns its
+// summary line. Every job owns its workload and runqueues, so jobs share no
+// state.
+std::string RunJob(const BatchJob &job) {
+  std::ostringstream summary;
+  summary << "file=" << job.path << " ";
+  // CFS has no request size, so only EEVDF jobs report one.
+  if (job.policy == "eevdf") summary << "slice=" << job.slice << " ";
+  Workload w;
+  if (!LoadTasks(job.path, &w)) {
+    summary << "policy=" << job.policy << " error=cannot-open" << std::endl;
+    return summary.str();
+  }
+  // A stream without a buffer is always bad, so every write is a no-op.
+  std::ostream trace(nullptr);
+  RunState state;
+  if (job.policy == "eevdf") {
+    EevdfState eevdf(&w.tasks);
+    RunEevdf(&w, job.slice, &state, &eevdf, CheckpointConfig(), trace);
+  } else {
+    RunCfs(&w, &state, CheckpointConfig(), nullptr, trace);
+  }
+  PrintMetrics(job.policy, state.metrics, summary);
+  return summary.str();
+}
+
+// Runs jobs on up to `threads` workers and writes their summaries to out in
+// job order. Workers claim the next unclaimed job from a shared counter, so
+// long and short runs balance across cores without a central queue.
+void RunBatch(const std::vector<BatchJob> &jobs, unsigned threads,
+              std::ostream &out) {
+  std::vector<std::string> summaries(jobs.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      summaries[i] = RunJob(jobs[i]);
+    }
+  };
+  threads = std::max(1u, std::min<unsigned>(threads, jobs.size()));
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; i++) pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool) t.join();
+  for (const auto &s : summaries) out << s;
+}
+
+void Usage(const char *prog) {
+  std::cerr << "Usage: " << prog
+            << " [--policy cfs|eevdf] [--slice N] [--metrics]"
+            << " [--checkpoint FILE [--checkpoint-every N]] [--resume FILE]"
+            << " [--monitor N]"
+            << " <task_file.dat>" << std::endl
+            << "       " << prog
+            << " [--policy cfs|eevdf] [--slice N] [--threads N]"
+            << " --batch <job_file>" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  // Parse command-line options.
+  std::string policy = "cfs";
+  unsigned slice = kDefaultSlice;
+  bool print_metrics = false;
+  CheckpointConfig checkpoint;
+  std::string resume;
+  std::string batch;
+  unsigned monitor_every = 0;
+  unsigned threads = std::thread::hardware_concurrency();
+  bool slice_given = false;
+  bool threads_given = false;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+      policy = argv[++i];
+    } else if (std::strcmp(argv[i], "--slice") == 0 && i + 1 < argc) {
+      slice = std::strtoul(argv[++i], nullptr, 10);
+      slice_given = true;
+    } else if (std::strcmp(argv[i], "--metrics") == 0) {
+      print_metrics = true;
+    } else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      checkpoint.path = argv[++i];
+    } else if (std::strcmp(argv[i], "--checkpoint-every") == 0 &&
+               i + 1 < argc) {
+      checkpoint.every = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+      resume = argv[++i];
+    } else if (std::strcmp(argv[i], "--monitor") == 0 && i + 1 < argc) {
+      monitor_every = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch = argv[++i];
+    } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = std::strtoul(argv[++i], nullptr, 10);
+      threads_given = true;
+    } else if (!path && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+  // Reject options that would otherwise be silently ignored. In batch mode
+  // --slice is the default for EEVDF jobs, so it is accepted with cfs.
+  bool orphan_every = checkpoint.every > 0 && checkpoint.path.empty();
+  bool stray_batch_option =
+      !batch.empty() && (!checkpoint.path.empty() || !resume.empty() ||
+                         print_metrics || monitor_every > 0);
+  bool stray_single_option =
+      batch.empty() && (threads_given || (slice_given && policy != "eevdf"));
+  bool stray_monitor = monitor_every > 0 && policy != "cfs";
+  if (!path == batch.empty() || (policy != "cfs" && policy != "eevdf") ||
+      slice == 0 || orphan_every || stray_batch_option ||
+      stray_single_option || stray_monitor) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  if (!batch.empty()) {
+    std::vector<BatchJob> jobs;
+    if (!ReadBatch(batch, policy, slice, &jobs)) return 1;
+    RunBatch(jobs, threads, std::cout);
+    return 0;
+  }
+
+  if (!checkpoint.path.empty()) std::signal(SIGUSR1, RequestCheckpoint);
+
+  Workload w;
+  if (!LoadTasks(path, &w)) {
+    std::cerr << "Error: cannot open file " << path << std::endl;
+    return 1;
+  }
+
+  RunState state;
+  EevdfState eevdf(&w.tasks);
+  if (!resume.empty()) {
+    try {
+      if (policy == "eevdf") {
+        LoadEevdf(resume, &w, &state, &eevdf);
+      } else {
+        LoadCfs(resume, &w, &state);
+      }
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (policy == "eevdf") {
+    RunEevdf(&w, slice, &state, &eevdf, checkpoint, std::cout);
+  } else {
+    std::unique_ptr<Monitor> monitor;
+    if (monitor_every > 0) monitor.reset(new Monitor(monitor_every, std::cerr));
+    RunCfs(&w, &state, checkpoint, monitor.get(), std::cout);
+  }
+  if (print_metrics) {
+    PrintMetrics(policy, state.metrics, std::cout);
+    if (policy == "cfs") PrintGroupMetrics(w.groups, std::cout);
   }
 
   return 0;
@@ -1,16 +1,63 @@
 #ifndef MULTIMAP_H_
 #define MULTIMAP_H_
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
-#include <memory>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
-// Multimap class using Red-Black Tree for ordered key-value pairs
-template <typename K, typename V>
+// Default value order of a Multimap: values are not compared at all.
+struct NoValueOrder {};
+
+// Multimap class using Red-Black Tree for ordered key-value pairs.
+// Given a value order Less, every node also tracks the smallest value of its
+// subtree, which lets MinValueAtMost() answer range-minimum queries in
+// O(log n). Without one, no summary is kept and V needs no ordering.
+//
+// Snapshot() returns an immutable View in O(1) that shares its nodes with the
+// map. Nodes count their links, and the writer copies a node a view still
+// links to before changing it (path copying), so an update costs O(log n)
+// extra nodes while views are live. With no live view every node has a
+// single link and updates change nodes in place. Snapshot() and all updates
+// must come from one thread; views may be read and released on any thread.
+template <typename K, typename V, typename Less = NoValueOrder>
 class Multimap {
+  struct Node;
+
  public:
+  // Immutable view of a Multimap as of the Snapshot() that returned it. The
+  // nodes it references are released when the last view holding them goes.
+  class View {
+   public:
+    View(const View& o) : root(o.root), size(o.size) { Retain(root); }
+    View(View&& o) : root(o.root), size(o.size) { o.root = nullptr; }
+    View& operator=(View o) {
+      std::swap(root, o.root);
+      size = o.size;
+      return *this;
+    }
+    ~View() { Release(root); }
+    unsigned int Size() const { return size; }
+    const K& Min() const;
+    const K& Max() const;
+    template <typename F>
+    void ForEach(F f) const;
+
+   private:
+    friend class Multimap;
+    View(const Node* r, unsigned int s) : root(r), size(s) {}
+    const Node* root;
+    unsigned int size;
+  };
+
+  explicit Multimap(const Less& less = Less()) : less(less) {}
+  Multimap(const Multimap&) = delete;
+  Multimap& operator=(const Multimap&) = delete;
+  ~Multimap() { Release(root); }
   unsigned int Size() const;
   V Get(const K& key) const;
   std::vector<V> GetAll(const K& key) const;
@@ -20,62 +67,110 @@ class Multimap {
   const K& Min() const;
   void Insert(const K& key, const V& value);
   void Remove(const K& key);
+  const V* MinValueAtMost(const K& bound) const;
+  void LoadSorted(const std::vector<K>& keys, const std::vector<V>& values);
+  template <typename F>
+  void ForEach(F f) const;
+  View Snapshot() const;
   void Print() const;
 
  private:
+  typedef std::integral_constant<bool, !std::is_same<Less, NoValueOrder>::value>
+      Augmented;
+
+  // Per-node summary, kept only when the map has a value order.
+  template <bool kAugmented, typename Unused = void>
+  struct Summary {
+    void SwapBest(Summary*) {}
+  };
+  template <typename Unused>
+  struct Summary<true, Unused> {
+    uint32_t best = 0;          // Index of the smallest value in values.
+    const Node* min = nullptr;  // Holder of the subtree minimum; null: self.
+    void SwapBest(Summary* o) { std::swap(best, o->best); }
+  };
+
   enum Color { RED, BLACK };
-  struct Node {
+  struct Node : Summary<Augmented::value> {
     K key;
     std::vector<V> values;
     bool color;
-    std::unique_ptr<Node> left;
-    std::unique_ptr<Node> right;
+    // Links to the node: from its parent in the map and in views, or as a
+    // view's root. The map changes a node in place only while it holds the
+    // single link.
+    mutable std::atomic<uint32_t> refs;
+    Node* left = nullptr;
+    Node* right = nullptr;
+    Node() : refs(1) {}
+    Node(const Node& o)
+        : Summary<Augmented::value>(o),
+          key(o.key),
+          values(o.values),
+          color(o.color),
+          refs(1),
+          left(o.left),
+          right(o.right) {}
   };
 
-  std::unique_ptr<Node> root;
+  Node* root = nullptr;
   unsigned int cur_size = 0;
+  Less less;
 
   Node* Get(Node* n, const K& key) const;
   Node* Min(Node* n) const;
-  void Insert(std::unique_ptr<Node>* n, const K& key, const V& value);
-  void Remove(std::unique_ptr<Node>* n, const K& key);
+  void Insert(Node** n, const K& key, const V& value);
+  void Remove(Node** n, const K& key);
   void Print(Node* n) const;
+  template <typename F>
+  static void ForEach(const Node* n, F* f);
+  Node* Build(const K* keys, const V* values, size_t count, unsigned height);
 
+  const V& Best(const Node* n) const;
+  const Node* MinNode(const Node* n) const;
+  void Append(Node* n, const V& value);
+  void Append(Node*, std::false_type) {}
+  void Append(Node* n, std::true_type);
+  void Pull(Node* n) { Pull(n, Augmented()); }
+  void Pull(Node*, std::false_type) {}
+  void Pull(Node* n, std::true_type);
+  static void Retain(const Node* n);
+  static void Release(const Node* n);
+  void Own(Node** n);
   bool IsRed(const Node* n) const;
   void FlipColors(Node* n);
-  void RotateRight(std::unique_ptr<Node>* prt);
-  void RotateLeft(std::unique_ptr<Node>* prt);
-  void FixUp(std::unique_ptr<Node>* n);
-  void MoveRedRight(std::unique_ptr<Node>* n);
-  void MoveRedLeft(std::unique_ptr<Node>* n);
-  void DeleteMin(std::unique_ptr<Node>* n);
+  void RotateRight(Node** prt);
+  void RotateLeft(Node** prt);
+  void FixUp(Node** n);
+  void MoveRedRight(Node** n);
+  void MoveRedLeft(Node** n);
+  void DeleteMin(Node** n);
 };
 
 // Returns the size of the multimap.
-template <typename K, typename V>
-unsigned int Multimap<K, V>::Size() const {
+template <typename K, typename V, typename Less>
+unsigned int Multimap<K, V, Less>::Size() const {
   return cur_size;
 }
 
 // Finds the node for the given key.
-template <typename K, typename V>
-typename Multimap<K, V>::Node* Multimap<K, V>::Get(Node* n,
-                                                    const K& key) const {
+template <typename K, typename V, typename Less>
+typename Multimap<K, V, Less>::Node* Multimap<K, V, Less>::Get(
+    Node* n, const K& key) const {
   while (n) {
     if (key == n->key) return n;
     if (key < n->key) {
-      n = n->left.get();
+      n = n->left;
     } else {
-      n = n->right.get();
+      n = n->right;
     }
   }
   return nullptr;
 }
 
 // Retrieves the first value for a given key.
-template <typename K, typename V>
-V Multimap<K, V>::Get(const K& key) const {
-  Node* n = Get(root.get(), key);
+template <typename K, typename V, typename Less>
+V Multimap<K, V, Less>::Get(const K& key) const {
+  Node* n = Get(root, key);
   if (!n || n->values.empty()) {
     throw std::runtime_error("Error: cannot find key");
   }
@@ -83,9 +178,9 @@ V Multimap<K, V>::Get(const K& key) const {
 }
 
 // Gets the first value for a key
-template <typename K, typename V>
-const V& Multimap<K, V>::GetFirst(const K& key) const {
-  Node* n = Get(root.get(), key);
+template <typename K, typename V, typename Less>
+const V& Multimap<K, V, Less>::GetFirst(const K& key) const {
+  Node* n = Get(root, key);
   if (!n || n->values.empty()) {
     throw std::runtime_error("Error: cannot find key");
   }
@@ -93,9 +188,9 @@ const V& Multimap<K, V>::GetFirst(const K& key) const {
 }
 
 // Retrieves all values associated with a key.
-template <typename K, typename V>
-std::vector<V> Multimap<K, V>::GetAll(const K& key) const {
-  Node* n = Get(root.get(), key);
+template <typename K, typename V, typename Less>
+std::vector<V> Multimap<K, V, Less>::GetAll(const K& key) const {
+  Node* n = Get(root, key);
   if (!n) {
     throw std::runtime_error("Error: cannot find key");
   }
@@ -103,207 +198,432 @@ std::vector<V> Multimap<K, V>::GetAll(const K& key) const {
 }
 
 // Checks if the key exists in the multimap.
-template <typename K, typename V>
-bool Multimap<K, V>::Contains(const K& key) const {
-  return Get(root.get(), key) != nullptr;
+template <typename K, typename V, typename Less>
+bool Multimap<K, V, Less>::Contains(const K& key) const {
+  return Get(root, key) != nullptr;
 }
 
 // Returns the maximum key in the multimap.
-template <typename K, typename V>
-const K& Multimap<K, V>::Max() const {
-  Node* n = root.get();
+template <typename K, typename V, typename Less>
+const K& Multimap<K, V, Less>::Max() const {
+  Node* n = root;
   while (n->right) {
-    n = n->right.get();
+    n = n->right;
   }
   return n->key;
 }
 
 // Returns the minimum key in the multimap.
-template <typename K, typename V>
-const K& Multimap<K, V>::Min() const {
-  return Min(root.get())->key;
+template <typename K, typename V, typename Less>
+const K& Multimap<K, V, Less>::Min() const {
+  return Min(root)->key;
 }
 
 // Finds the minimum node in a subtree.
-template <typename K, typename V>
-typename Multimap<K, V>::Node* Multimap<K, V>::Min(Node* n) const {
-  return n->left ? Min(n->left.get()) : n;
+template <typename K, typename V, typename Less>
+typename Multimap<K, V, Less>::Node* Multimap<K, V, Less>::Min(
+    Node* n) const {
+  return n->left ? Min(n->left) : n;
+}
+
+// Returns the smallest value stored in a single node.
+template <typename K, typename V, typename Less>
+const V& Multimap<K, V, Less>::Best(const Node* n) const {
+  return n->values[n->best];
+}
+
+// Returns the node holding the smallest value of a subtree.
+template <typename K, typename V, typename Less>
+const typename Multimap<K, V, Less>::Node* Multimap<K, V, Less>::MinNode(
+    const Node* n) const {
+  return n->min ? n->min : n;
+}
+
+// Adds a value to a node, keeping the node's smallest value current in O(1).
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Append(Node* n, const V& value) {
+  n->values.push_back(value);
+  Append(n, Augmented());
+}
+
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Append(Node* n, std::true_type) {
+  if (less(n->values.back(), Best(n))) n->best = n->values.size() - 1;
+}
+
+// Recomputes the subtree minimum of a node from its children.
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Pull(Node* n, std::true_type) {
+  const Node* min = n;
+  if (n->left && less(Best(MinNode(n->left)), Best(min))) {
+    min = MinNode(n->left);
+  }
+  if (n->right && less(Best(MinNode(n->right)), Best(min))) {
+    min = MinNode(n->right);
+  }
+  n->min = min == n ? nullptr : min;
+}
+
+// Adds a link to n.
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Retain(const Node* n) {
+  if (n) n->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Drops a link to n, freeing n and dropping its own links if it was the last.
+// The acquire-release count orders every read of a node through a view
+// before the node is freed or changed by the writer.
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Release(const Node* n) {
+  while (n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    Release(n->left);
+    const Node* right = n->right;
+    delete n;
+    n = right;
+  }
+}
+
+// Makes *n a node the writer may change, replacing it by a private copy if a
+// view still links to it. The copy links to the same children, which are
+// thereby shared in turn and get copied when the writer reaches them.
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Own(Node** n) {
+  if ((*n)->refs.load(std::memory_order_acquire) == 1) return;
+  Node* copy = new Node(**n);
+  Retain(copy->left);
+  Retain(copy->right);
+  Release(*n);
+  *n = copy;
+}
+
+// Returns an immutable view of the current contents in O(1).
+template <typename K, typename V, typename Less>
+typename Multimap<K, V, Less>::View Multimap<K, V, Less>::Snapshot() const {
+  Retain(root);
+  return View(root, cur_size);
+}
+
+// Returns the minimum key of the view.
+template <typename K, typename V, typename Less>
+const K& Multimap<K, V, Less>::View::Min() const {
+  const Node* n = root;
+  while (n->left) n = n->left;
+  return n->key;
+}
+
+// Returns the maximum key of the view.
+template <typename K, typename V, typename Less>
+const K& Multimap<K, V, Less>::View::Max() const {
+  const Node* n = root;
+  while (n->right) n = n->right;
+  return n->key;
+}
+
+// Calls f(key, value) for every value of the view in key order.
+template <typename K, typename V, typename Less>
+template <typename F>
+void Multimap<K, V, Less>::View::ForEach(F f) const {
+  Multimap::ForEach(root, &f);
+}
+
+// Returns the smallest value among all entries whose key is not greater than
+// bound, or nullptr if there is no such entry. Only O(log n) nodes are
+// visited: whenever a node qualifies, its whole left subtree does as well and
+// is summarized by its cached minimum.
+template <typename K, typename V, typename Less>
+const V* Multimap<K, V, Less>::MinValueAtMost(const K& bound) const {
+  static_assert(Augmented::value, "MinValueAtMost() needs a value order");
+  const Node* best = nullptr;
+  const Node* n = root;
+  while (n) {
+    if (bound < n->key) {
+      n = n->left;
+      continue;
+    }
+    if (n->left && (!best || less(Best(MinNode(n->left)), Best(best)))) {
+      best = MinNode(n->left);
+    }
+    if (!best || less(Best(n), Best(best))) best = n;
+    n = n->right;
+  }
+  return best ? &Best(best) : nullptr;
 }
 
 // Checks if a node is red.
-template <typename K, typename V>
-bool Multimap<K, V>::IsRed(const Node* n) const {
+template <typename K, typename V, typename Less>
+bool Multimap<K, V, Less>::IsRed(const Node* n) const {
   return n && (n->color == RED);
 }
 
 // Flips colors to maintain Red-Black properties.
-template <typename K, typename V>
-void Multimap<K, V>::FlipColors(Node* n) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::FlipColors(Node* n) {
+  Own(&n->left);
+  Own(&n->right);
   n->color = !n->color;
   n->left->color = !n->left->color;
   n->right->color = !n->right->color;
 }
 
 // Rotates the subtree right.
-template <typename K, typename V>
-void Multimap<K, V>::RotateRight(std::unique_ptr<Node>* prt) {
-  std::unique_ptr<Node> chd(std::move((*prt)->left));
-  (*prt)->left = std::move(chd->right);
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::RotateRight(Node** prt) {
+  Own(prt);
+  Own(&(*prt)->left);
+  Node* chd = (*prt)->left;
+  (*prt)->left = chd->right;
   chd->color = (*prt)->color;
   (*prt)->color = RED;
-  chd->right = std::move(*prt);
-  *prt = std::move(chd);
+  chd->right = *prt;
+  Pull(chd->right);
+  Pull(chd);
+  *prt = chd;
 }
 
 // Rotates the subtree left.
-template <typename K, typename V>
-void Multimap<K, V>::RotateLeft(std::unique_ptr<Node>* prt) {
-  std::unique_ptr<Node> chd(std::move((*prt)->right));
-  (*prt)->right = std::move(chd->left);
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::RotateLeft(Node** prt) {
+  Own(prt);
+  Own(&(*prt)->right);
+  Node* chd = (*prt)->right;
+  (*prt)->right = chd->left;
   chd->color = (*prt)->color;
   (*prt)->color = RED;
-  chd->left = std::move(*prt);
-  *prt = std::move(chd);
+  chd->left = *prt;
+  Pull(chd->left);
+  Pull(chd);
+  *prt = chd;
 }
 
 // Inserts a key-value pair into the multimap.
-template <typename K, typename V>
-void Multimap<K, V>::Insert(const K& key, const V& value) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Insert(const K& key, const V& value) {
   Insert(&root, key, value);
   cur_size++;
   root->color = BLACK;
 }
 
 // Private insert helper function.
-template <typename K, typename V>
-void Multimap<K, V>::Insert(std::unique_ptr<Node>* n,
-                            const K& key, const V& value) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Insert(Node** n,
+                                  const K& key, const V& value) {
   if (!*n) {
-    // C++11 compatible way to create a unique_ptr
-    std::unique_ptr<Node> new_node(new Node());
-    new_node->key = key;
-    new_node->values.push_back(value);
-    new_node->color = RED;
-    *n = std::move(new_node);
-  } else if (key < (*n)->key) {
+    *n = new Node();
+    (*n)->key = key;
+    Append(*n, value);
+    (*n)->color = RED;
+    return;
+  }
+  Own(n);
+  if (key < (*n)->key) {
     Insert(&((*n)->left), key, value);
   } else if (key > (*n)->key) {
     Insert(&((*n)->right), key, value);
   } else {
-    (*n)->values.push_back(value);
+    Append(*n, value);
     cur_size--;
   }
   FixUp(n);
 }
 
 // Fix up the tree balance after insertion
-template <typename K, typename V>
-void Multimap<K, V>::FixUp(std::unique_ptr<Node>* n) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::FixUp(Node** n) {
   // If right child is red and left child is black, rotate left
-  if (IsRed((*n)->right.get()) && !IsRed((*n)->left.get())) {
+  if (IsRed((*n)->right) && !IsRed((*n)->left)) {
     RotateLeft(n);
   }
   // If left child and left-left grandchild are red, rotate right
-  if (IsRed((*n)->left.get()) && IsRed((*n)->left->left.get())) {
+  if (IsRed((*n)->left) && IsRed((*n)->left->left)) {
     RotateRight(n);
   }
   // If both children are red, flip colors
-  if (IsRed((*n)->left.get()) && IsRed((*n)->right.get())) {
-    FlipColors(n->get());
+  if (IsRed((*n)->left) && IsRed((*n)->right)) {
+    FlipColors(*n);
   }
+  Pull(*n);
 }
 
 // Prints the multimap in-order.
-template <typename K, typename V>
-void Multimap<K, V>::Print() const {
-  Print(root.get());
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Print() const {
+  Print(root);
   std::cout << std::endl;
 }
 
 // Private print helper function.
-template <typename K, typename V>
-void Multimap<K, V>::Print(Node* n) const {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Print(Node* n) const {
   if (!n) return;
-  Print(n->left.get());
+  Print(n->left);
   std::cout << "<" << n->key << ": ";
   for (const auto& val : n->values) {
     std::cout << val << " ";
   }
   std::cout << "> ";
-  Print(n->right.get());
+  Print(n->right);
+}
+
+// Calls f(key, value) for every value in key order.
+template <typename K, typename V, typename Less>
+template <typename F>
+void Multimap<K, V, Less>::ForEach(F f) const {
+  ForEach(root, &f);
+}
+
+// Private in-order traversal helper function.
+template <typename K, typename V, typename Less>
+template <typename F>
+void Multimap<K, V, Less>::ForEach(const Node* n, F* f) {
+  if (!n) return;
+  ForEach(n->left, f);
+  for (const auto& val : n->values) (*f)(n->key, val);
+  ForEach(n->right, f);
+}
+
+// Replaces the contents with keys[i] -> values[i]. Keys must be strictly
+// increasing. The tree is built directly in O(n) instead of by n insertions.
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::LoadSorted(const std::vector<K>& keys,
+                                      const std::vector<V>& values) {
+  if (keys.size() != values.size()) {
+    throw std::runtime_error("Error: keys and values differ in size");
+  }
+  for (size_t i = 1; i < keys.size(); i++) {
+    if (!(keys[i - 1] < keys[i])) {
+      throw std::runtime_error("Error: keys are not strictly increasing");
+    }
+  }
+  // A black height of h holds between 2^h - 1 nodes (all 2-nodes) and
+  // 3^h - 1 nodes (all 3-nodes); pick the smallest h that fits.
+  unsigned height = 0;
+  for (size_t cap = 0; cap < keys.size(); cap = cap * 3 + 2) height++;
+  Release(root);
+  root = Build(keys.data(), values.data(), keys.size(), height);
+  cur_size = keys.size();
+}
+
+// Builds a left-leaning subtree of the given black height from count sorted
+// entries. Every black node with a red left child forms a 3-node.
+template <typename K, typename V, typename Less>
+typename Multimap<K, V, Less>::Node* Multimap<K, V, Less>::Build(
+    const K* keys, const V* values, size_t count, unsigned height) {
+  if (count == 0) return nullptr;
+  size_t max_child = 0;  // 3^(height - 1) - 1
+  for (unsigned i = 1; i < height; i++) max_child = max_child * 3 + 2;
+  Node* n = new Node();
+  n->color = BLACK;
+  if (count - 1 <= 2 * max_child) {
+    // 2-node: split the remaining entries evenly.
+    size_t left = (count - 1) / 2;
+    n->left = Build(keys, values, left, height - 1);
+    n->key = keys[left];
+    Append(n, values[left]);
+    n->right = Build(keys + left + 1, values + left + 1, count - left - 1,
+                     height - 1);
+  } else {
+    // 3-node: a red left child and three subtrees of equal black height.
+    size_t rest = count - 2;
+    size_t a = (rest + 2) / 3, b = (rest + 1) / 3, c = rest / 3;
+    Node* red = new Node();
+    red->color = RED;
+    red->left = Build(keys, values, a, height - 1);
+    red->key = keys[a];
+    Append(red, values[a]);
+    red->right = Build(keys + a + 1, values + a + 1, b, height - 1);
+    Pull(red);
+    n->left = red;
+    n->key = keys[a + b + 1];
+    Append(n, values[a + b + 1]);
+    n->right = Build(keys + a + b + 2, values + a + b + 2, c, height - 1);
+  }
+  Pull(n);
+  return n;
 }
 
 // Move red nodes to the right
-template <typename K, typename V>
-void Multimap<K, V>::MoveRedRight(std::unique_ptr<Node>* n) {
-  FlipColors(n->get());
-  if (IsRed((*n)->left->left.get())) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::MoveRedRight(Node** n) {
+  FlipColors(*n);
+  if (IsRed((*n)->left->left)) {
     RotateRight(n);
-    FlipColors(n->get());
+    FlipColors(*n);
   }
 }
 
 // Move red nodes to the left
-template <typename K, typename V>
-void Multimap<K, V>::MoveRedLeft(std::unique_ptr<Node>* n) {
-  FlipColors(n->get());
-  if (IsRed((*n)->right->left.get())) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::MoveRedLeft(Node** n) {
+  FlipColors(*n);
+  if (IsRed((*n)->right->left)) {
     RotateRight(&((*n)->right));
     RotateLeft(n);
-    FlipColors(n->get());
+    FlipColors(*n);
   }
 }
 
 // Delete the minimum key
-template <typename K, typename V>
-void Multimap<K, V>::DeleteMin(std::unique_ptr<Node>* n) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::DeleteMin(Node** n) {
   if (!(*n)->left) {
+    Release(*n);
     *n = nullptr;
     return;
   }
-  if (!IsRed((*n)->left.get()) && !IsRed((*n)->left->left.get())) {
+  Own(n);
+  if (!IsRed((*n)->left) && !IsRed((*n)->left->left)) {
     MoveRedLeft(n);
   }
   DeleteMin(&((*n)->left));
   FixUp(n);
 }
 // Remove a key and all its values
-template <typename K, typename V>
-void Multimap<K, V>::Remove(const K& key) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Remove(const K& key) {
   if (!Contains(key)) return;
   Remove(&root, key);
+  cur_size--;
   if (root) root->color = BLACK;
 }
 
 // Private remove helper function
-template <typename K, typename V>
-void Multimap<K, V>::Remove(std::unique_ptr<Node>* n, const K& key) {
+template <typename K, typename V, typename Less>
+void Multimap<K, V, Less>::Remove(Node** n, const K& key) {
+  Own(n);
   if (key < (*n)->key) {
     // Move red left if needed
-    if (!IsRed((*n)->left.get()) && !IsRed((*n)->left->left.get())) {
+    if (!IsRed((*n)->left) && !IsRed((*n)->left->left)) {
       MoveRedLeft(n);
     }
     Remove(&((*n)->left), key);
   } else {
     // If left child is red, rotate right
-    if (IsRed((*n)->left.get())) {
+    if (IsRed((*n)->left)) {
       RotateRight(n);
     }
     // Found the key and no right child
     if (key == (*n)->key && !(*n)->right) {
+      Release(*n);
       *n = nullptr;
       return;
     }
     // Move red right if needed
-    if (!IsRed((*n)->right.get()) && !IsRed((*n)->right->left.get())) {
+    if (!IsRed((*n)->right) && !IsRed((*n)->right->left)) {
       MoveRedRight(n);
     }
     // Found the key
     if (key == (*n)->key) {
-      // Find successor (min of right subtree)
-      Node* successor = Min((*n)->right.get());
-      (*n)->key = successor->key;
-      (*n)->values = std::move(successor->values);
+      // Find successor (min of right subtree), owning the path to it so that
+      // its values can be swapped rather than copied. The successor keeps a
+      // non-empty vector for the subtree minimums recomputed until DeleteMin
+      // frees it.
+      Node** successor = &(*n)->right;
+      for (Own(successor); (*successor)->left; Own(successor)) {
+        successor = &(*successor)->left;
+      }
+      (*n)->key = (*successor)->key;
+      std::swap((*n)->values, (*successor)->values);
+      (*n)->SwapBest(*successor);
       // Delete the successor
       DeleteMin(&((*n)->right));
     } else {
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>  // C++ testing library header
+
+#include <cstdio>  // C++ system header
+#include <fstream>  // C++ system header
+#include <sstream>  // C++ system header
+#include <string>  // C++ system header
+
+// Runs ./cfs_sched with the given options on a task file holding `tasks` and
+// returns the id of the task that ran at every tick, '_' when idle.
+std::string RunTrace(const std::string &options, const std::string &tasks) {
+  const char *path = "test_cfs_sched.dat";
+  std::ofstream(path) << tasks;
+  std::string command = "./cfs_sched " + options + " " + path;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (!pipe) return "";
+  std::string output;
+  char buf[256];
+  while (std::fgets(buf, sizeof(buf), pipe)) output += buf;
+  pclose(pipe);
+  std::remove(path);
+
+  // Every trace line is "<tick> [<runnable>]: <id>", with '*' appended when
+  // the task finishes.
+  std::string ids;
+  std::istringstream lines(output);
+  std::string tick, runnable;
+  char id;
+  while (lines >> tick >> runnable >> id) {
+    ids += id;
+    lines.ignore(256, '\n');
+  }
+  return ids;
+}
+
+class CfsSched_Eevdf_Test : public ::testing::Test {
+ protected:
+  const std::string tasks = "A 0 5\nB 0 5\n";
+};
+
+TEST_F(CfsSched_Eevdf_Test, EqualDeadlinesDoNotPreempt) {
+  EXPECT_EQ(RunTrace("--policy eevdf --slice 1", tasks), "ABABABABAB");
+  EXPECT_EQ(RunTrace("--policy eevdf --slice 3", tasks), "AAABBBAABB");
+  EXPECT_EQ(RunTrace("--policy eevdf --slice 10", tasks), "AAAAABBBBB");
+}
+
+TEST_F(CfsSched_Eevdf_Test, SliceRunsTaskThatManyTicksInARow) {
+  for (unsigned slice = 1; slice <= 5; slice++) {
+    std::string trace = RunTrace(
+        "--policy eevdf --slice " + std::to_string(slice), tasks);
+    ASSERT_EQ(trace.size(), 10u);
+    // Until one task finishes, the two alternate in runs of `slice` ticks.
+    for (size_t i = 0; i + 1 < 2 * slice && i + 1 < trace.size(); i++) {
+      bool same_request = (i + 1) % slice != 0;
+      EXPECT_EQ(trace[i] == trace[i + 1], same_request)
+          << "slice=" << slice << " tick=" << i;
+    }
+  }
+}
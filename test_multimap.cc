@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>  // C++ testing library header
 
+#include <algorithm>  // C++ system header
+#include <functional>  // C++ system header
 #include <string>  // C++ system header
+#include <thread>  // C++ system header
 #include <vector>  // C++ system header
 #include "multimap.h"
 class Multimap_OneKey_Test : public ::testing::Test {
@@ -38,3 +41,112 @@ TEST_F(Multimap_MultipleValues_Test, InsertMultipleValuesForSameKey) {
   EXPECT_EQ(values[0], "value1");
   EXPECT_EQ(values[1], "value2");
 }
+
+class Multimap_MinValueAtMost_Test : public ::testing::Test {
+ protected:
+  Multimap<int, int, std::less<int>> mmap;
+};
+
+TEST_F(Multimap_MinValueAtMost_Test, ReturnsSmallestValueWithinBound) {
+  int keys[] = {5, 1, 9, 3, 7, 2, 8};
+  int values[] = {40, 70, 10, 60, 20, 50, 30};
+  for (int i = 0; i < 7; i++) mmap.Insert(keys[i], values[i]);
+  EXPECT_EQ(mmap.MinValueAtMost(0), nullptr);
+  EXPECT_EQ(*mmap.MinValueAtMost(1), 70);
+  EXPECT_EQ(*mmap.MinValueAtMost(4), 50);
+  EXPECT_EQ(*mmap.MinValueAtMost(6), 40);
+  EXPECT_EQ(*mmap.MinValueAtMost(8), 20);
+  EXPECT_EQ(*mmap.MinValueAtMost(9), 10);
+  mmap.Remove(9);
+  mmap.Remove(7);
+  EXPECT_EQ(mmap.Size(), 5);
+  EXPECT_EQ(*mmap.MinValueAtMost(100), 30);
+}
+
+TEST_F(Multimap_MinValueAtMost_Test, TracksManyValuesUnderOneKey) {
+  for (int i = 0; i < 100; i++) mmap.Insert(i, 1000000 + i);
+  for (int i = 0; i < 100000; i++) mmap.Insert(50, 500000 - i);
+  EXPECT_EQ(mmap.Size(), 100);
+  EXPECT_EQ(mmap.GetAll(50).size(), 100001);
+  EXPECT_EQ(*mmap.MinValueAtMost(49), 1000000);
+  EXPECT_EQ(*mmap.MinValueAtMost(50), 400001);
+  mmap.Insert(20, 7);
+  EXPECT_EQ(*mmap.MinValueAtMost(99), 7);
+  mmap.Remove(20);
+  mmap.Remove(50);
+  EXPECT_EQ(*mmap.MinValueAtMost(99), 1000000);
+}
+
+class Multimap_LoadSorted_Test : public ::testing::Test {
+ protected:
+  Multimap<int, int, std::less<int>> mmap;
+};
+
+TEST_F(Multimap_LoadSorted_Test, BuildsTreeThatSupportsUpdates) {
+  std::vector<int> keys, values;
+  for (int i = 0; i < 100; i++) {
+    keys.push_back(i * 2);
+    values.push_back(1000 - i);
+  }
+  mmap.LoadSorted(keys, values);
+  EXPECT_EQ(mmap.Size(), 100);
+  EXPECT_EQ(mmap.Min(), 0);
+  EXPECT_EQ(mmap.Max(), 198);
+  EXPECT_EQ(*mmap.MinValueAtMost(50), 975);
+  for (int i = 0; i < 100; i += 2) mmap.Remove(i * 2);
+  mmap.Insert(51, 1);
+  std::vector<int> seen;
+  mmap.ForEach([&](int key, int) { seen.push_back(key); });
+  EXPECT_EQ(seen.size(), 51);
+  EXPECT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+  EXPECT_EQ(*mmap.MinValueAtMost(51), 1);
+}
+
+class Multimap_Snapshot_Test : public ::testing::Test {
+ protected:
+  Multimap<int, int> mmap;
+};
+
+TEST_F(Multimap_Snapshot_Test, ViewIsUnchangedByLaterUpdates) {
+  for (int i = 0; i < 50; i++) mmap.Insert(i, i);
+  Multimap<int, int>::View view = mmap.Snapshot();
+  for (int i = 0; i < 50; i += 2) mmap.Remove(i);
+  mmap.Insert(100, 7);
+  mmap.Insert(1, 8);
+  EXPECT_EQ(view.Size(), 50);
+  EXPECT_EQ(view.Min(), 0);
+  EXPECT_EQ(view.Max(), 49);
+  std::vector<int> seen;
+  view.ForEach([&](int key, int) { seen.push_back(key); });
+  EXPECT_EQ(seen.size(), 50);
+  EXPECT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+  EXPECT_EQ(mmap.Size(), 26);
+  EXPECT_EQ(mmap.GetAll(1).size(), 2);
+  EXPECT_EQ(mmap.Max(), 100);
+}
+
+TEST_F(Multimap_Snapshot_Test, ReaderThreadSeesFixedContents) {
+  for (int i = 0; i < 1000; i++) mmap.Insert(i, i);
+  Multimap<int, int>::View view = mmap.Snapshot();
+  bool stable = true;
+  std::thread reader([&view, &stable]() {
+    for (int round = 0; round < 50; round++) {
+      int expected = 0;
+      view.ForEach([&](int key, int value) {
+        if (key != expected || value != expected) stable = false;
+        expected++;
+      });
+      if (expected != 1000) stable = false;
+    }
+  });
+  for (int i = 0; i < 20000; i++) {
+    if (i % 2) {
+      mmap.Insert(i % 1500, -i);
+    } else {
+      mmap.Remove(i % 1000);
+    }
+  }
+  reader.join();
+  EXPECT_TRUE(stable);
+  EXPECT_EQ(view.Size(), 1000);
+}